@@ -0,0 +1,395 @@
+/*	I/O path benchmarks, run against bench/fakemdb (or any mdb in $MDB_EXEC)
+	usage: bench_io [filter]
+	prints one JSON object per line: {"bench", "case", "value", "unit"}
+	and exits non-zero if a result is not what fakemdb should give
+	BENCH_SCALE multiplies the iteration counts (default 1)	*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mdblib.h"
+
+
+static double scale = 1;
+static int failures = 0;
+
+#define CHECK(cond)										\
+	do {												\
+		if (!(cond)) {									\
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+			failures++;									\
+		}												\
+	} while (0);
+
+
+/*	utility functions	*/
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static size_t iterations(size_t base)
+{
+	size_t n = base*scale;
+	return n ? n : 1;
+}
+
+static void report(const char *bench, const char *c, double value, const char *unit)
+{
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}\n", bench, c, value, unit);
+	fflush(stdout);
+}
+
+static long rss_bytes()
+{
+	long pages = 0;
+	long resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident*sysconf(_SC_PAGESIZE);
+}
+
+static mdbhandle *start(const char *breakpoints, const char *listlines)
+{
+	// fakemdb reads its response sizes from the environment it inherits
+	setenv("FAKEMDB_BREAKPOINTS", breakpoints, 1);
+	setenv("FAKEMDB_LISTLINES", listlines, 1);
+
+	mdbhandle *handle = mdb_init();
+	if (handle == NULL) {
+		fprintf(stderr, "could not start %s\n", getenv("MDB_EXEC"));
+		exit(1);
+	}
+	return handle;
+}
+
+static void stop(mdbhandle *handle)
+{
+	mdb_quit(handle);
+	mdb_close(handle);
+}
+
+
+/*	benchmarks	*/
+
+static void bench_roundtrip()
+{
+	mdbhandle *handle = start("0", "0");
+	size_t n = iterations(2000);
+	size_t i;
+
+	for (i = 0; i < 100; i++)
+		mdb_echo(handle, "warmup");
+
+	double begin = now();
+	for (i = 0; i < n; i++)
+		mdb_echo(handle, "ping");
+	report("roundtrip", "echo", (now() - begin)*1e9/n, "ns/op");
+
+	stop(handle);
+}
+
+static void bench_large_output()
+{
+	static const char *sizes[] = {"1000", "20000"};
+	size_t s;
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+		mdbhandle *handle = start("0", sizes[s]);
+		size_t n = iterations(20000/atoi(sizes[s]) + 10);
+		size_t bytes = 0;
+		size_t i;
+
+		double begin = now();
+		for (i = 0; i < n; i++)
+			bytes += strlen(mdb_list(handle));
+		double elapsed = now() - begin;
+
+		char c[64];
+		snprintf(c, sizeof(c), "list lines=%s", sizes[s]);
+		report("large_output", c, elapsed*1e9/n, "ns/op");
+		report("large_output", c, bytes/elapsed/1e6, "MB/s");
+
+		stop(handle);
+	}
+}
+
+static void bench_breakpoints()
+{
+	static const char *sizes[] = {"100", "1000", "5000"};
+	size_t s;
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+		mdbhandle *handle = start(sizes[s], "0");
+		size_t n = iterations(50000/atoi(sizes[s]) + 10);
+		size_t parsed = 0;
+		size_t i;
+
+		double begin = now();
+		for (i = 0; i < n; i++) {
+			mdbbp **breakpoints = mdb_info_break(handle);
+			size_t k;
+			for (k = 0; breakpoints[k]; k++)
+				;
+			parsed += k;
+		}
+		double elapsed = now() - begin;
+
+		char c[64];
+		snprintf(c, sizeof(c), "info break entries=%s", sizes[s]);
+		report("breakpoints", c, elapsed*1e9/n, "ns/op");
+		report("breakpoints", c, parsed/elapsed, "entries/s");
+
+		stop(handle);
+	}
+}
+
+static void bench_memory()
+{
+	mdbhandle *handle = start("0", "0");
+	size_t n = iterations(500);
+	size_t i;
+
+	mdbword words[256];
+	for (i = 0; i < 256; i++)
+		words[i] = i;
+
+	double begin = now();
+	for (i = 0; i < n; i++)
+		mdb_x(handle, 'r', 256, 'x', 'b', 0x20);
+	report("memory", "x words=256", 256*n/(now() - begin), "words/s");
+
+	begin = now();
+	for (i = 0; i < n; i++)
+		mdb_write_mem(handle, 'r', 0x20, 256, words);
+	report("memory", "write words=256", 256*n/(now() - begin), "words/s");
+
+	stop(handle);
+}
+
+static void bench_prefetch()
+{
+	// every stop is followed by a backtrace and a listing; prefetched, the
+	// listing is pipelined behind the backtrace that first sees the stop
+	static const char *modes[] = {"off", "on"};
+	size_t m;
+	for (m = 0; m < sizeof(modes)/sizeof(modes[0]); m++) {
+		mdbhandle *handle = start("0", "20");
+		size_t n = iterations(500);
+		size_t i;
+
+		mdb_break_line(handle, "main.c", 10, 0);	// fakemdb then stops after each Continue
+		if (m) {
+			mdb_prefetch_backtrace(handle, 0, 1);
+			mdb_prefetch_list(handle);
+		}
+
+		double begin = now();
+		for (i = 0; i < n; i++) {
+			mdb_continue(handle);
+			char *backtrace = mdb_backtrace(handle, 0, 1);
+			CHECK(strncmp(backtrace, "backtrace 1\n#0 ", 15) == 0);
+			CHECK(mdb_state(handle) == mdb_stopped);
+			char *listing = mdb_list(handle);
+			CHECK(strncmp(listing, "list\n1\t", 7) == 0);
+		}
+
+		char c[64];
+		snprintf(c, sizeof(c), "stop backtrace list prefetch=%s", modes[m]);
+		report("prefetch", c, (now() - begin)*1e9/n, "ns/op");
+
+		stop(handle);
+	}
+}
+
+static void bench_trace()
+{
+	// fakemdb runs FAKEMDB_RUN (100) instructions per Continue, and prints
+	// the instruction count for a variable, the stopwatch and pc/2
+	mdbhandle *handle = start("0", "0");
+	size_t n = iterations(1000);
+
+	FILE *log = tmpfile();
+	if (log == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	CHECK(mdb_trace_var(handle, "counter", "W") >= 0);
+
+	double begin = now();
+	CHECK(mdb_trace_run(handle, log, n, 1000) == n);
+	report("trace", "watch counter", n/(now() - begin), "hits/s");
+
+	rewind(log);
+	mdbtracerec rec;
+	size_t logged = 0;
+	int consistent = 1;
+	while (mdb_trace_read(log, &rec)) {
+		consistent &= rec.new_value - rec.old_value == 100;
+		consistent &= rec.cycle == rec.new_value && rec.pc == 2*rec.new_value;
+		logged++;
+	}
+	CHECK(logged == n);
+	CHECK(consistent);
+
+	fclose(log);
+	mdb_trace_clear(handle);
+	stop(handle);
+}
+
+static int at_least(const long values[], void *arg)
+{
+	return values[0] >= *(long *)arg;
+}
+
+static void bench_until()
+{
+	// fakemdb prints the instruction count since Reset for any variable,
+	// so "counter >= goal" first holds exactly goal instructions in
+	mdbhandle *handle = start("0", "0");
+	mdbprobe probe = {mdb_probe_var, "counter", 0, 0, 0};
+	long goal = 1000;
+	size_t n = iterations(50);
+	size_t steps;
+	size_t i;
+
+	double begin = now();
+	for (i = 0; i < n; i++) {
+		mdb_reset(handle);
+		steps = 0;
+		CHECK(mdb_until(handle, &probe, 1, at_least, &goal, 100000, &steps) == mdb_until_met);
+		CHECK(steps == 1000);
+	}
+	report("until", "counter>=1000", (now() - begin)*1e9/n, "ns/op");
+
+	// after a command that may change the target there is nothing to
+	// replay from, so the hit is only known to lie in the last chunk
+	mdb_set(handle, "system.disableerrormsg", "true");
+	goal = 2000;
+	steps = 0;
+	CHECK(mdb_until(handle, &probe, 1, at_least, &goal, 100000, &steps) == mdb_until_overshot);
+	CHECK(steps >= 1000);
+
+	stop(handle);
+}
+
+typedef struct _worker {
+	mdbhandle *handle;
+	size_t n;
+	pthread_t thread;
+} worker;
+
+static void *roundtrips(void *arg)
+{
+	worker *w = arg;
+	size_t i;
+	for (i = 0; i < w->n; i++)
+		mdb_echo(w->handle, "ping");
+	return NULL;
+}
+
+static void bench_multi_handle()
+{
+	setenv("FAKEMDB_BREAKPOINTS", "0", 1);
+	setenv("FAKEMDB_LISTLINES", "0", 1);
+
+	size_t handles;
+	for (handles = 1; handles <= 8; handles *= 2) {
+		worker workers[8];
+		size_t n = iterations(1000);
+		size_t i;
+
+		double begin = now();
+		for (i = 0; i < handles; i++) {
+			workers[i].handle = mdb_init_async(NULL);
+			workers[i].n = n;
+		}
+		for (i = 0; i < handles; i++)
+			mdb_noop(workers[i].handle);	// waits for startup
+
+		char c[64];
+		snprintf(c, sizeof(c), "handles=%zu", handles);
+		report("multi_handle", c, (now() - begin)*1e3, "ms startup");
+
+		begin = now();
+		for (i = 0; i < handles; i++)
+			pthread_create(&workers[i].thread, NULL, roundtrips, &workers[i]);
+		for (i = 0; i < handles; i++)
+			pthread_join(workers[i].thread, NULL);
+		report("multi_handle", c, handles*n/(now() - begin), "ops/s");
+
+		for (i = 0; i < handles; i++)
+			stop(workers[i].handle);
+	}
+}
+
+static void bench_footprint()
+{
+	// heap the handle holds, and resident memory of the whole process per
+	// handle (which includes pdip's share)
+	enum {count = 16};
+	mdbhandle *handles[count];
+	size_t i;
+
+	long before = rss_bytes();
+	for (i = 0; i < count; i++)
+		handles[i] = start("5000", "5000");
+	long idle = rss_bytes();
+
+	report("footprint", "idle handle", mdb_footprint(handles[0]), "bytes");
+	report("footprint", "idle handle rss", (double)(idle - before)/count, "bytes");
+
+	for (i = 0; i < count; i++) {
+		mdb_info_break(handles[i]);
+		mdb_list(handles[i]);
+		mdb_echo(handles[i], "settle");
+	}
+	long active = rss_bytes();
+
+	report("footprint", "active handle", mdb_footprint(handles[0]), "bytes");
+	report("footprint", "active handle rss", (double)(active - before)/count, "bytes");
+
+	for (i = 0; i < count; i++)
+		stop(handles[i]);
+}
+
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		void (*run)();
+	} benches[] = {
+		{"roundtrip", bench_roundtrip},
+		{"large_output", bench_large_output},
+		{"breakpoints", bench_breakpoints},
+		{"memory", bench_memory},
+		{"prefetch", bench_prefetch},
+		{"trace", bench_trace},
+		{"until", bench_until},
+		{"multi_handle", bench_multi_handle},
+		{"footprint", bench_footprint},
+	};
+
+	const char *filter = (argc > 1) ? argv[1] : "";
+	if (getenv("BENCH_SCALE"))
+		scale = atof(getenv("BENCH_SCALE"));
+	if (getenv("MDB_EXEC") == NULL)
+		setenv("MDB_EXEC", "bench/fakemdb", 1);
+
+	size_t i;
+	for (i = 0; i < sizeof(benches)/sizeof(benches[0]); i++)
+		if (strstr(benches[i].name, filter))
+			benches[i].run();
+
+	if (failures)
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	return failures != 0;
+}
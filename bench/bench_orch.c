@@ -0,0 +1,76 @@
+/*	simulated cycles per wall-second versus device count, as counted by
+	each device's stopwatch
+	usage: bench_orch [device] [program] [maxdevices] [slices] [slice]
+	"-" skips device or program; output is one JSON object per line,
+	as for bench_io	*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mdborch.h"
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static char *optional(int argc, char *argv[], int i)
+{
+	return (argc > i && strcmp(argv[i], "-") != 0) ? argv[i] : NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	char *device = optional(argc, argv, 1);
+	char *program = optional(argc, argv, 2);
+	size_t maxdevices = (argc > 3) ? strtoul(argv[3], NULL, 0) : 8;
+	size_t slices = (argc > 4) ? strtoul(argv[4], NULL, 0) : 100;
+	unsigned int slice = (argc > 5) ? strtoul(argv[5], NULL, 0) : 1000;
+
+	if (getenv("MDB_EXEC") == NULL)
+		setenv("MDB_EXEC", "bench/fakemdb", 1);
+
+	size_t devices;
+	for (devices = 1; devices <= maxdevices; devices *= 2) {
+		mdborch *orch = mdb_orch_new(mdb_slice_stepi, slice);
+
+		// devices in a ring, each driving the next one's input
+		size_t i;
+		for (i = 0; i < devices; i++)
+			if (mdb_orch_add(orch, device, program) < 0) {
+				fprintf(stderr, "could not start %s\n", getenv("MDB_EXEC"));
+				return 1;
+			}
+		if (devices > 1)
+			for (i = 0; i < devices; i++)
+				mdb_orch_link(orch, i, "RB0", (i + 1) % devices, "RB1");
+
+		mdb_orch_run(orch, 1);	// waits for every device to start
+
+		// the stopwatch is read between runs, while no worker uses the handles
+		unsigned long long cycles = 0;
+		for (i = 0; i < devices; i++)
+			cycles -= mdb_stopwatch_val(mdb_orch_handle(orch, i));
+
+		double start = now();
+		mdb_orch_run(orch, slices);
+		double elapsed = now() - start;
+
+		for (i = 0; i < devices; i++)
+			cycles += mdb_stopwatch_val(mdb_orch_handle(orch, i));
+
+		char c[64];
+		snprintf(c, sizeof(c), "devices=%zu slice=%u", devices, slice);
+		printf("{\"bench\":\"orch\",\"case\":\"%s\",\"value\":%.3f,\"unit\":\"cycles/s\"}\n", c, (double)cycles/devices/elapsed);
+		printf("{\"bench\":\"orch\",\"case\":\"%s total\",\"value\":%.3f,\"unit\":\"cycles/s\"}\n", c, cycles/elapsed);
+		fflush(stdout);
+
+		mdb_orch_close(orch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*	checks and times the shared-memory ring without mdb or pdip; links
+	against libmdbshm.a alone
+	usage: bench_shm [records]
+	exits non-zero if a reader sees something it should not; results are
+	one JSON object per line, as for bench_io	*/
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mdbshm.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond)										\
+	do {												\
+		if (!(cond)) {									\
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+			failures++;									\
+		}												\
+	} while (0);
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void publish(mdbshm *shm, unsigned long n)
+{
+	char record[32];
+	int length = snprintf(record, sizeof(record), "record %lu", n);
+	mdb_shm_publish(shm, mdb_shm_result, record, length);
+}
+
+static int is_record(const mdbshmrec *rec, unsigned long n)
+{
+	char record[32];
+	int length = snprintf(record, sizeof(record), "record %lu", n);
+	return rec->length == (size_t)length && memcmp(rec->data, record, length) == 0;
+}
+
+
+static void check_ring(const char *name)
+{
+	enum {slots = 8};
+	mdbshm *writer = mdb_shm_create(name, slots, 32);
+	CHECK(writer != NULL);
+	if (writer == NULL)
+		return;
+
+	mdbshm *reader = mdb_shm_attach(name);
+	CHECK(reader != NULL);
+	mdbshmrec rec;
+
+	// a live segment is never taken over by a second writer
+	CHECK(mdb_shm_create(name, slots, 32) == NULL);
+
+	// catch-up: a reader sees every record in order, then nothing
+	unsigned long n;
+	for (n = 0; n < 3; n++)
+		publish(writer, n);
+	for (n = 0; n < 3; n++) {
+		CHECK(mdb_shm_next(reader, &rec) == 1);
+		CHECK(rec.seq == n && rec.type == mdb_shm_result && is_record(&rec, n));
+	}
+	CHECK(mdb_shm_next(reader, &rec) == 0);
+
+	// a late reader starts at the next record published
+	mdbshm *late = mdb_shm_attach(name);
+	CHECK(late != NULL);
+	publish(writer, 3);
+	CHECK(mdb_shm_next(late, &rec) == 1 && is_record(&rec, 3));
+	CHECK(mdb_shm_next(reader, &rec) == 1 && is_record(&rec, 3));
+
+	// lapping: publishing past slots loses the oldest records only
+	for (n = 4; n < 4 + 3*slots; n++)
+		publish(writer, n);
+	CHECK(mdb_shm_next(reader, &rec) == MDB_SHM_LOST);
+	for (n = 4 + 2*slots; n < 4 + 3*slots; n++) {
+		CHECK(mdb_shm_next(reader, &rec) == 1);
+		CHECK(rec.seq == n && is_record(&rec, n));
+	}
+	CHECK(mdb_shm_next(reader, &rec) == 0);
+
+	// a record read in place is reported invalid once overwritten
+	publish(writer, n);
+	CHECK(mdb_shm_next(reader, &rec) == 1 && mdb_shm_valid(reader, &rec));
+	for (n++; n < 4 + 4*slots + 1; n++)
+		publish(writer, n);
+	CHECK(!mdb_shm_valid(reader, &rec));
+
+	// oversized payloads are truncated to a slot
+	char big[100];
+	memset(big, 'x', sizeof(big));
+	mdbshm *fresh = mdb_shm_attach(name);
+	mdb_shm_publish(writer, mdb_shm_memory, big, sizeof(big));
+	CHECK(mdb_shm_next(fresh, &rec) == 1);
+	CHECK(rec.type == mdb_shm_memory && rec.truncated && rec.length == 32);
+
+	mdb_shm_close(fresh);
+	mdb_shm_close(late);
+	mdb_shm_close(reader);
+	mdb_shm_close(writer);
+
+	CHECK(mdb_shm_attach(name) == NULL);	// the creator unlinked it
+}
+
+typedef struct _writer {
+	mdbshm *shm;
+	unsigned long first;
+	unsigned long count;
+	pthread_t thread;
+} writer;
+
+static void *publish_range(void *arg)
+{
+	writer *w = arg;
+	unsigned long n;
+	for (n = w->first; n < w->first + w->count; n++)
+		publish(w->shm, n);
+	return NULL;
+}
+
+static void check_writers(const char *name)
+{
+	// handles on separate threads may share one ring; every record must
+	// arrive exactly once and intact
+	enum {threads = 4, each = 20000};
+	mdbshm *shm = mdb_shm_create(name, threads*each, 32);
+	CHECK(shm != NULL);
+	if (shm == NULL)
+		return;
+	mdbshm *reader = mdb_shm_attach(name);
+	CHECK(reader != NULL);
+
+	writer writers[threads];
+	size_t i;
+	for (i = 0; i < threads; i++) {
+		writers[i].shm = shm;
+		writers[i].first = i*each;
+		writers[i].count = each;
+		pthread_create(&writers[i].thread, NULL, publish_range, &writers[i]);
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(writers[i].thread, NULL);
+
+	char *seen = calloc(threads*each, 1);
+	if (seen == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	mdbshmrec rec;
+	unsigned long received = 0;
+	int intact = 1;
+	while (mdb_shm_next(reader, &rec) == 1) {
+		unsigned long n = strtoul(rec.data + 7, NULL, 10);
+		if (n >= threads*each || seen[n] || !is_record(&rec, n))
+			intact = 0;
+		else
+			seen[n] = 1;
+		received++;
+	}
+	CHECK(intact);
+	CHECK(received == threads*each);
+
+	free(seen);
+	mdb_shm_close(reader);
+	mdb_shm_close(shm);
+}
+
+static void bench_throughput(const char *name, unsigned long records)
+{
+	// writer and reader cost timed separately in one process: a reader in
+	// another process only measures how far it falls behind the writer
+	enum {slots = 4096};
+	mdbshm *writer = mdb_shm_create(name, slots, 64);
+	CHECK(writer != NULL);
+	if (writer == NULL)
+		return;
+	mdbshm *reader = mdb_shm_attach(name);
+	CHECK(reader != NULL);
+
+	char record[64];
+	memset(record, 'r', sizeof(record));
+	double published = 0;
+	double read = 0;
+	unsigned long received = 0;
+	unsigned long n;
+	for (n = 0; n < records; n += slots) {
+		unsigned long batch = (records - n < slots) ? records - n : slots;
+		unsigned long i;
+
+		double begin = now();
+		for (i = 0; i < batch; i++)
+			mdb_shm_publish(writer, mdb_shm_result, record, sizeof(record));
+		published += now() - begin;
+
+		mdbshmrec rec;
+		begin = now();
+		while (mdb_shm_next(reader, &rec) == 1)
+			received++;
+		read += now() - begin;
+	}
+	CHECK(received == records);
+
+	mdb_shm_close(reader);
+	mdb_shm_close(writer);
+
+	printf("{\"bench\":\"shm\",\"case\":\"publish bytes=64\",\"value\":%.3f,\"unit\":\"records/s\"}\n", records/published);
+	printf("{\"bench\":\"shm\",\"case\":\"read bytes=64\",\"value\":%.3f,\"unit\":\"records/s\"}\n", records/read);
+	fflush(stdout);
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned long records = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/mdbshm-bench-%d", (int)getpid());
+
+	check_ring(name);
+	check_writers(name);
+	bench_throughput(name, records);
+
+	if (failures)
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	return failures != 0;
+}
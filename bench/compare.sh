@@ -0,0 +1,36 @@
+#!/bin/sh
+# compares two "make bench-run" result files, e.g. from two commits:
+#	bench/compare.sh old_output.txt bench_output.txt
+# rates ("/s") and shares ("%") are better higher; times ("ns/op", "ms")
+# and sizes ("bytes") are better lower; any other unit gets no verdict
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 old new" >&2
+	exit 2
+fi
+
+awk '
+function field(line, name,	rest) {
+	rest = substr(line, index(line, "\"" name "\":") + length(name) + 3)
+	if (substr(rest, 1, 1) == "\"")
+		return substr(rest, 2, index(substr(rest, 2), "\"") - 1)
+	match(rest, /^[-0-9.eE+]+/)
+	return substr(rest, 1, RLENGTH)
+}
+/^\{/ {
+	key = field($0, "bench") " | " field($0, "case") " | " field($0, "unit")
+	if (FNR == NR) {
+		old[key] = field($0, "value")
+	} else if (key in old) {
+		unit = field($0, "unit")
+		ratio = (old[key] != 0) ? field($0, "value") / old[key] : 0
+		if (unit ~ /\/s$/ || unit == "%")
+			better = ratio >= 1
+		else if (unit ~ /^(ns\/op|ms|bytes)/)
+			better = ratio <= 1
+		else
+			better = -1
+		printf "%-60s %14.3f %14.3f %7.3fx %s\n", key, old[key], field($0, "value"), ratio, (better == 0) ? "(worse)" : ""
+	}
+}
+' "$1" "$2"
@@ -0,0 +1,120 @@
+/*	stand-in for mdb with canned, sized responses for benchmarking
+	FAKEMDB_BREAKPOINTS	rows returned by "info breakpoints" (default 1000)
+	FAKEMDB_LISTLINES	lines returned by "list" (default 1000)
+	FAKEMDB_STARTUP		milliseconds to wait before the first prompt (default 0)
+	FAKEMDB_RUN			instructions a Continue runs before it reports a stop, when
+						a breakpoint or watchpoint is set (default 100)	*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+static long env_long(const char *name, long fallback)
+{
+	const char *value = getenv(name);
+	return value ? strtol(value, NULL, 0) : fallback;
+}
+
+static int terminal_echoes()
+{
+	// under a pty the terminal already echoes input; only echo ourselves
+	// when it does not, so the output has exactly one echo like mdb
+	struct termios t;
+	return isatty(0) && tcgetattr(0, &t) == 0 && (t.c_lflag & ECHO);
+}
+
+int main()
+{
+	long breakpoints = env_long("FAKEMDB_BREAKPOINTS", 1000);
+	long listlines = env_long("FAKEMDB_LISTLINES", 1000);
+	long startup = env_long("FAKEMDB_STARTUP", 0);
+	long run = env_long("FAKEMDB_RUN", 100);
+	int echo = !terminal_echoes();
+
+	unsigned long long stepped = 0;
+	int number = 0;
+	int armed = 0;		// breakpoints and watchpoints set
+
+	if (startup > 0)
+		usleep(startup*1000);
+
+	char line[4096];
+	printf(">");
+	fflush(stdout);
+	while (fgets(line, sizeof(line), stdin)) {
+		if (echo)
+			fputs(line, stdout);
+		line[strcspn(line, "\n")] = '\0';
+
+		char *arg = strrchr(line, ' ');
+		arg = arg ? arg + 1 : line;
+
+		if (strcmp(line, "quit") == 0) {
+			printf(">");
+			fflush(stdout);
+			break;
+		} else if (strncmp(line, "info breakpoints", 16) == 0) {
+			long i;
+			printf("Num\tType\tEnabled\tAddress\twhat\n");
+			for (i = 0; i < breakpoints; i++)
+				printf("%ld\ty\t0x%lx\tmain.c\t%ld\n", i + 1, 0x100 + 2*i, 10 + i);
+		} else if (strncmp(line, "list", 4) == 0) {
+			long i;
+			for (i = 0; i < listlines; i++)
+				printf("%ld\t\tPORTB = lookup[(counter + %ld) & 0x0F];\n", i + 1, i);
+		} else if (strncmp(line, "print pin ", 10) == 0) {
+			printf("%s: high\n", arg);
+		} else if (strncmp(line, "print /a ", 9) == 0) {
+			printf("The Address of %s: 0x%zx\n", arg, 0x20 + strlen(arg));
+		} else if (strncmp(line, "print /x ", 9) == 0) {
+			printf("%s=\n0x%llx\n", arg, 2*stepped);
+		} else if (strncmp(line, "print ", 6) == 0) {
+			printf("%s=\n%llu\n", arg, stepped);
+		} else if (strncmp(line, "x /", 3) == 0) {
+			// x /tnfu addr: one row of up to 8 words per line
+			unsigned long n = strtoul(line + 4, NULL, 10);
+			unsigned long addr = strtoul(arg, NULL, 16);
+			unsigned long i;
+			for (i = 0; i < n; i++) {
+				if (i % 8 == 0)
+					printf("%s0x%04lx:", i ? "\n" : "", addr + i);
+				printf(" 0x%02lx", (unsigned long)((addr + i + stepped) & 0xFF));
+			}
+			printf("\n");
+		} else if (strncmp(line, "Stepi", 5) == 0) {
+			stepped += (line[5] == ' ') ? strtoull(line + 6, NULL, 10) : 1;
+		} else if (strcmp(line, "Reset") == 0 || strncmp(line, "Program", 7) == 0) {
+			stepped = 0;
+		} else if (strcmp(line, "Stopwatch") == 0) {
+			printf("Stopwatch cycle count = %llu\n", stepped);
+		} else if (strncmp(line, "break", 5) == 0) {
+			printf("Breakpoint %d at 0x100\n", ++number);
+			armed++;
+		} else if (strncmp(line, "watch", 5) == 0) {
+			printf("Watchpoint %d\n", ++number);
+			armed++;
+		} else if (strcmp(line, "delete") == 0) {
+			armed = 0;
+		} else if (strncmp(line, "delete ", 7) == 0) {
+			armed -= (armed > 0);
+		} else if (strcmp(line, "Continue") == 0 && armed) {
+			// the prompt comes back at once; the stop is reported later,
+			// ahead of whatever is read next
+			stepped += run;
+			printf(">Stop at\n\taddress:0x%llx\nHALTED\n", 2*stepped);
+			fflush(stdout);
+			continue;
+		} else if (strncmp(line, "backtrace", 9) == 0) {
+			printf("#0  0x%llx in main at main.c:%llu\n", 2*stepped, 10 + stepped % 100);
+		} else if (strncmp(line, "echo ", 5) == 0) {
+			printf("%s\n", line + 5);
+		}
+
+		printf(">");
+		fflush(stdout);
+	}
+
+	return 0;
+}
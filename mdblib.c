@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -13,6 +14,7 @@
 #include "pdip.h"
 
 #include "mdblib.h"
+#include "mdbshm.h"
 
 
 #define MDB_EFRMT	"ERROR!\n\tFile:\t%s\n\tLine:\t%d\n\tFunc:\t%s()\n\tErrno:\t%d\n\tErrstr:\t%s\n"
@@ -48,6 +50,14 @@
 #define MDB_PROMPT_REG "^>"
 #endif // MDB_PROMPT_REG
 
+#ifndef MDB_HALTED_REG
+#define MDB_HALTED_REG "HALTED\n"
+#endif // MDB_HALTED_REG
+
+#ifndef MDB_PC_REG
+#define MDB_PC_REG "pc"
+#endif // MDB_PC_REG
+
 
 struct _mdbbp {
 	int number;
@@ -58,17 +68,127 @@ struct _mdbbp {
 };
 
 
+typedef struct _mdbtrace {
+	char *variable;
+	int watchpoint;
+	mdbptr address;
+	mdbword value;
+} mdbtrace;
+
+
+typedef struct _mdbchunk {
+	struct _mdbchunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+} mdbchunk;
+
+
+typedef struct _mdbarena {	// parsed results, valid until the next parse
+	mdbchunk *head;
+	size_t size;			// total capacity of all chunks
+} mdbarena;
+
+
+typedef struct _mdbquery {
+	char *command;
+	char *buffer;
+	size_t bufsize;
+	int valid;
+	int stopped;			// a stop report was read along with the response
+} mdbquery;
+
+
 struct _mdbhandle {
 	pdip_cfg_t cfg;
 	pdip_t pdip;
 	int	pid;
 	mdbstate state;
-	char *buffer;
+	char *buffer;			// receive buffer, kept at its high-water mark
+	size_t bufsize;
+	char *sendbuf;			// formatted commands, kept at its high-water mark
+	size_t sendsize;
+	char *scratch;			// command arguments built up piecewise, same
+	size_t scratchsize;
+	mdbarena arena;
+	mdbquery *prefetch;		// queries pipelined when a stop is detected
+	size_t prefetchc;
+	mdbshm *shm;			// optional output channel
+	mdbtrace *trace;		// variables watched by mdb_trace_run()
+	size_t tracec;
+	long stepped;			// instructions since Reset/Program, -1 when unknown
+	pthread_t startup;		// mdb_init_async() thread, joined at first use
+	mdbconfig *config;
+	int starting;
 };
 
 
+#ifndef MDB_ARENA_CHUNK
+#define MDB_ARENA_CHUNK 4096
+#endif // MDB_ARENA_CHUNK
+
+
 /*	utility functions	*/
-mdbbp **parse_breakpoints(char *buffer)
+static void *arena_alloc(mdbarena *arena, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+
+	mdbchunk *chunk = arena->head;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t c_size = (size > MDB_ARENA_CHUNK) ? size : MDB_ARENA_CHUNK;
+		chunk = malloc(sizeof(mdbchunk) + c_size);
+		if (chunk == NULL) MDB_ERR();
+
+		chunk->next = arena->head;
+		chunk->size = c_size;
+		chunk->used = 0;
+		arena->head = chunk;
+		arena->size += c_size;
+	}
+
+	void *memory = chunk->data + chunk->used;
+	chunk->used += size;
+	return memory;
+}
+
+static char *arena_strdup(mdbarena *arena, const char *string)
+{
+	size_t size = strlen(string) + 1;
+	char *copy = arena_alloc(arena, size);
+	memcpy(copy, string, size);
+	return copy;
+}
+
+static void arena_free(mdbarena *arena)
+{
+	while (arena->head) {
+		mdbchunk *next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+	arena->size = 0;
+}
+
+static void arena_reset(mdbarena *arena)
+{
+	// once the arena has outgrown a single chunk, replace the chunks with
+	// one holding all of them, so steady state is one chunk and no malloc
+	if (arena->head && arena->head->next) {
+		size_t size = arena->size;
+		arena_free(arena);
+		arena->head = malloc(sizeof(mdbchunk) + size);
+		if (arena->head == NULL) MDB_ERR();
+
+		arena->head->next = NULL;
+		arena->head->size = size;
+		arena->size = size;
+	}
+
+	if (arena->head)
+		arena->head->used = 0;
+}
+
+static mdbbp **parse_breakpoints(mdbhandle *handle, char *buffer)
 {
 	// expects buffer to be the output of mdb "info break"
 	// first output line is just column lables, so ignore
@@ -77,68 +197,102 @@ mdbbp **parse_breakpoints(char *buffer)
 	// is perfectly acceptable, and preservation of buffer contents is unneeded
 	enum {junk, number, enabled, address, filename, line};
 
-	mdbbp **output;
-	mdbbp *breakpoint;
+	// a new parse is the boundary; the previous result expires here, not
+	// on the next send, so callers can act on it (e.g. mdb_delete() each)
+	arena_reset(&handle->arena);
+
 	size_t o_size = 0;
-	size_t f_size = 0;
+	size_t o_cap = 16;
+	mdbbp **output = arena_alloc(&handle->arena, (o_cap + 1)*sizeof(mdbbp *));
+	mdbbp *breakpoint = NULL;
 
-	char *tok_buff = buffer;
-	char *token;
+	char *save = NULL;
+	char *token = strtok_r(buffer, "\n\t ", &save);
 	int type = junk;
-	do {
-		token = strtok(tok_buff, "\n\t ");
-
-		if (strlen(token)) {
-			switch (type) {
-				case number:
-					o_size++;	// not particularly efficient; optimize later
-					output = realloc(output, o_size);
-					output[o_size-1] = NULL;
-
-					breakpoint = malloc(sizeof(breakpoint));
-					breakpoint->number = atoi(token);
-					type = enabled;
-					break;
-				case enabled:
-					breakpoint->enabled = *token;
-					type = address;
-					break;
-				case address:
-					breakpoint->address = (mdbptr)atoi(token);
-					type = filename;
-					break;
-				case filename:
-					f_size = strlen(token);
-					breakpoint->filename = malloc(f_size);
-					strcpy(breakpoint->filename, token);
-					type = line;
-					break;
-				case line:
-					breakpoint->line = (size_t)atoi(token);
+	for (; token; token = strtok_r(NULL, "\n\t ", &save)) {
+		switch (type) {
+			case number:
+				breakpoint = arena_alloc(&handle->arena, sizeof(mdbbp));
+				breakpoint->number = atoi(token);
+				type = enabled;
+				break;
+			case enabled:
+				breakpoint->enabled = *token;
+				type = address;
+				break;
+			case address:
+				breakpoint->address = (mdbptr)strtoul(token, NULL, 0);
+				type = filename;
+				break;
+			case filename:
+				breakpoint->filename = arena_strdup(&handle->arena, token);
+				type = line;
+				break;
+			case line:
+				breakpoint->line = (size_t)strtoul(token, NULL, 10);
+				type = number;
+
+				if (o_size == o_cap) {	// arena memory is not reallocated, only left behind
+					mdbbp **grown = arena_alloc(&handle->arena, (2*o_cap + 1)*sizeof(mdbbp *));
+					memcpy(grown, output, o_size*sizeof(mdbbp *));
+					output = grown;
+					o_cap *= 2;
+				}
+				output[o_size++] = breakpoint;
+				break;
+
+			case junk:
+			default:
+				if (strcmp(token, "what") == 0)
 					type = number;
-
-					output[o_size-1] = breakpoint;
-					break;
-
-				case junk:
-				default:
-					if (strcmp(token, "what") == 0)
-						type = number;
-			}
 		}
+	}
 
-		if (tok_buff)
-			tok_buff = NULL;
-	} while (token);
+	// returned array MUST be null terminated; an incomplete trailing
+	// breakpoint is simply never added
+	output[o_size] = NULL;
+	return output;
+}
 
-	if (output[o_size-1] == NULL)	// throw way incomplete breakpoint
-		mdb_close_breakpoint(breakpoint);
-	else {	// returned array MUST be null terminated
-		output = realloc(output, o_size + 1);
-		output[o_size] = NULL;
+static size_t print_var_offset(char f, size_t value, const char *variable)
+{
+	// offset of the value in the output of mdb "print", past the echoed command
+	if (value) {
+		if (f == 'a')
+			return snprintf(NULL, 0, "print /a /datasize:%zu %s\nThe Address of %s: ", value, variable, variable);
+		else
+			return snprintf(NULL, 0, "print /%c /datasize:%zu %s\n%s=\n", f, value, variable, variable);
+	} else {
+		if (f == 'a')
+			return snprintf(NULL, 0, "print /a %s\nThe Address of %s: ", variable, variable);
+		else
+			return snprintf(NULL, 0, "print /%c %s\n%s=\n", f, variable, variable);
 	}
+}
 
-	return output;
+static unsigned long long parse_stopwatch(const char *result)
+{
+	// first number following the echoed "Stopwatch" command
+	const char *digits = strchr(result, '\n');
+	if (digits == NULL)
+		return 0;
+
+	digits += strcspn(digits, "0123456789");
+	return strtoull(digits, NULL, 10);
+}
+
+// the handle a startup thread is bringing up; that thread must not wait on
+// itself, and handle->startup may not be stored yet when it first runs
+static _Thread_local mdbhandle *starting_up = NULL;
+
+static void mdb_ready(mdbhandle *handle)
+{
+	// blocks until a handle from mdb_init_async() has finished starting up
+	if (handle->starting && starting_up != handle) {
+		errno = pthread_join(handle->startup, NULL);
+		if (errno) MDB_ERR();
+		handle->starting = 0;
+	}
 }
 
 void mdb_noop(mdbhandle *handle)
@@ -148,6 +302,7 @@ void mdb_noop(mdbhandle *handle)
 
 mdbstate mdb_state(mdbhandle *handle)
 {
+	mdb_ready(handle);
 	return handle->state;
 }
 
@@ -160,13 +315,192 @@ unsigned long long time_in_ms()
 	return (unsigned long long)((tv.tv_sec * 1000) + (tv.tv_usec / 1000));
 }
 
+static void grow_buffer(char **buffer, size_t *bufsize, size_t size)
+{
+	if (*bufsize < size) {
+		*buffer = realloc(*buffer, size);
+		if (*buffer == NULL) MDB_ERR();
+		*bufsize = size;
+	}
+}
+
+static char *mdb_vformat(char **buffer, size_t *bufsize, const char *format, va_list arg)
+{
+	va_list arg2;
+	va_copy(arg2, arg);
+	size_t size = vsnprintf(NULL, 0, format, arg2) + 1;
+	va_end(arg2);
+
+	grow_buffer(buffer, bufsize, size);
+	vsnprintf(*buffer, size, format, arg);
+	return *buffer;
+}
+
+static void track_steps(mdbhandle *handle, const char *command)
+{
+	// mdb_until() can only replay from Reset if it knows every instruction
+	// since then and that nothing else changed the target, so anything that
+	// is not a Stepi, Reset, Program or a known read-only query forgets it
+	static const char *queries[] = {
+		"\n", "print ", "x ", "info ", "backtrace", "list", "echo",
+		"help", "pwd", "Stopwatch\n", "Hwtool\n", NULL
+	};
+
+	const char *line;
+	for (line = command; *line; line = strchr(line, '\n') + 1) {
+		if (strncmp(line, "Stepi", 5) == 0 && (line[5] == '\n' || line[5] == ' ')) {
+			if (handle->stepped >= 0)
+				handle->stepped += (line[5] == ' ') ? strtol(line + 6, NULL, 10) : 1;
+		} else if (strncmp(line, "Reset\n", 6) == 0 || strncmp(line, "Program ", 8) == 0) {
+			handle->stepped = 0;
+		} else {
+			size_t i;
+			for (i = 0; queries[i] && strncmp(line, queries[i], strlen(queries[i])) != 0; i++)
+				;
+			if (queries[i] == NULL)
+				handle->stepped = -1;
+		}
+
+		if (strchr(line, '\n') == NULL)
+			break;
+	}
+}
+
+static void mdb_send(mdbhandle *handle, const char *command)
+{
+	mdb_ready(handle);
+
+	// anything sent to mdb may change what a prefetched query would answer
+	// (list position, breakpoints, memory...), so only results served
+	// without a send survive
+	size_t i;
+	for (i = 0; i < handle->prefetchc; i++)
+		handle->prefetch[i].valid = 0;
+
+	track_steps(handle, command);
+
+	MDB_DBG("%s", command);
+	int result = pdip_send(handle->pdip, "%s", command);
+	if (result < 0 ) MDB_ERR();
+}
+
+static void mdb_publish(mdbhandle *handle, mdbshmtype type, const char *data)
+{
+	if (handle->shm)
+		mdb_shm_publish(handle->shm, type, data, strlen(data));
+}
+
+static int mdb_recv(mdbhandle *handle, char **buffer, size_t *bufsize, struct timeval *timeout)
+{
+	// reads one prompt terminated response, skipping over a stop report
+	// that arrived ahead of it; returns 1 if there was one. timeout bounds
+	// the wait for the rest once a stop report was read, as after a
+	// Continue nothing more may follow it
+	mdb_ready(handle);
+
+	size_t datasize = 0;
+	int result = pdip_recv(handle->pdip, MDB_PROMPT_REG, buffer, bufsize, &datasize, (struct timeval*)0);
+	if (result == PDIP_RECV_ERROR) MDB_ERR();
+
+	// check for breakpoint message
+	static const char bp_msg[] = "Stop at";//"\nSingle breakpoint: @0x";
+	//result = strncmp(*buffer, bp_msg, sizeof(bp_msg)/sizeof(char)-1);
+	char *breakpoint = strstr(*buffer, bp_msg);
+//printf("strncmp():\t%d\tsize:\t%d\n", result, sizeof(bp_msg)/sizeof(char)-1);
+	if (breakpoint && !strstr(*buffer, "quit")) {
+		MDB_DBG("Breakpoint detected; re-attempting read\n");
+		MDB_DBG("%s\n", *buffer);
+		handle->state = mdb_stopped;
+		handle->stepped = -1;	// whatever was running stopped partway
+		mdb_publish(handle, mdb_shm_stop, *buffer);
+
+		// the whole report may have come ahead of the prompt already; cut
+		// it out so the response keeps its "<command>\n<output>" layout
+		char *halted = strstr(breakpoint, MDB_HALTED_REG);
+		if (halted) {
+			halted += strlen(MDB_HALTED_REG);
+			memmove(breakpoint, halted, strlen(halted) + 1);
+			return 1;
+		}
+
+		// eat "HALTED" message
+		result = pdip_recv(handle->pdip, MDB_HALTED_REG, buffer, bufsize, &datasize, timeout);
+		if (result == PDIP_RECV_ERROR) MDB_ERR();
+		// read the actual message we were after
+		if (result == PDIP_RECV_FOUND) {
+			result = pdip_recv(handle->pdip, MDB_PROMPT_REG, buffer, bufsize, &datasize, timeout);
+			if (result == PDIP_RECV_ERROR) MDB_ERR();
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static void query_prepend(mdbquery *query, const char *text)
+{
+	size_t t_size = strlen(text);
+	size_t b_size = strlen(query->buffer) + 1;
+
+	grow_buffer(&query->buffer, &query->bufsize, t_size + b_size);
+	memmove(query->buffer + t_size, query->buffer, b_size);
+	memcpy(query->buffer, text, t_size);
+}
+
+static void mdb_batch(mdbhandle *handle, mdbquery queries[], size_t n, struct timeval *timeout)
+{
+	// sends every command in a single write, then collects one prompt
+	// terminated response per command, noting which ones came with a stop
+	if (n == 0)
+		return;
+
+	size_t i;
+	size_t size = 1;
+	for (i = 0; i < n; i++)
+		size += strlen(queries[i].command);
+
+	grow_buffer(&handle->sendbuf, &handle->sendsize, size);
+	char *batch = handle->sendbuf;
+
+	size = 0;
+	for (i = 0; i < n; i++) {
+		strcpy(batch + size, queries[i].command);
+		size += strlen(queries[i].command);
+	}
+	mdb_send(handle, batch);
+
+	for (i = 0; i < n; i++) {
+		queries[i].stopped = mdb_recv(handle, &queries[i].buffer, &queries[i].bufsize, timeout);
+		queries[i].valid = 1;
+	}
+
+	// a terminal echoes every line of the batch as soon as it is written, so
+	// the first response may carry the echoes of all the others; move them
+	// back in front of the response they belong to so callers can rely on
+	// the usual "<command>\n<output>" layout
+	char *echo = queries[0].buffer;
+	if (strncmp(echo, queries[0].command, strlen(queries[0].command)) != 0)
+		return;
+	echo += strlen(queries[0].command);
+
+	size_t moved;
+	for (moved = 1; moved < n; moved++) {
+		size_t c_size = strlen(queries[moved].command);
+		if (strncmp(echo, queries[moved].command, c_size) != 0)
+			break;
+		echo += c_size;
+		query_prepend(&queries[moved], queries[moved].command);
+	}
+	memmove(queries[0].buffer + strlen(queries[0].command), echo, strlen(echo) + 1);
+}
+
 
 /*	process management	*/
 
-mdbhandle *mdb_init()
+static mdbhandle *mdb_launch()
 {
-	MDB_DBG("Initializing an MDB handle.\n");
 	mdbhandle *handle = malloc(sizeof(mdbhandle));
+	if (handle == NULL) MDB_ERR();
 
 	// set up pdip
 	pdip_configure(1, 0);
@@ -177,11 +511,27 @@ mdbhandle *mdb_init()
 
 	handle->state = mdb_stopped;
 	handle->buffer = NULL;
+	handle->bufsize = 0;
+	handle->sendbuf = NULL;
+	handle->sendsize = 0;
+	handle->scratch = NULL;
+	handle->scratchsize = 0;
+	handle->arena.head = NULL;
+	handle->arena.size = 0;
+	handle->prefetch = NULL;
+	handle->prefetchc = 0;
+	handle->shm = NULL;
+	handle->trace = NULL;
+	handle->tracec = 0;
+	handle->stepped = -1;
+	handle->config = NULL;
+	handle->starting = 0;
 
 	// technically using strlen() like this is hackish, but it should work
 	// cmnd is a NULL terminated array.
+	// $MDB_EXEC overrides the built in path, e.g. to run a stand-in
 	char *cmnd[2];
-	cmnd[0] = MDB_EXEC;
+	cmnd[0] = getenv("MDB_EXEC") ? getenv("MDB_EXEC") : MDB_EXEC;
 	cmnd[1] = (char *)0;
 	handle->pid = pdip_exec(handle->pdip, 1, cmnd);
 
@@ -190,20 +540,98 @@ mdbhandle *mdb_init()
 		handle = NULL;
 	}
 
+	return handle;
+}
+
+static void *mdb_startup(void *arg)
+{
+	// runs on its own thread; mdb_ready() lets this thread through
+	mdbhandle *handle = arg;
+	mdbconfig *config = handle->config;
+	starting_up = handle;
+
 	mdb_get(handle);	// eat initial prompt
 
+	if (config->device)
+		mdb_device(handle, config->device);
+	if (config->hwtool)
+		mdb_hwtool(handle, config->hwtool, config->hwtool_p, config->hwtool_index);
+	if (config->program)
+		mdb_program(handle, config->program);
+
+	free(config->device);
+	free(config->hwtool);
+	free(config->program);
+	free(config);
+
+	return NULL;
+}
+
+static char *config_strdup(const char *string)
+{
+	char *copy = NULL;
+	if (string) {
+		copy = strdup(string);
+		if (copy == NULL) MDB_ERR();
+	}
+	return copy;
+}
+
+mdbhandle *mdb_init()
+{
+	MDB_DBG("Initializing an MDB handle.\n");
+	mdbhandle *handle = mdb_launch();
+
+	if (handle)
+		mdb_get(handle);	// eat initial prompt
+
+	return handle;
+}
+
+mdbhandle *mdb_init_async(const mdbconfig *config)
+{
+	MDB_DBG("Initializing an MDB handle in the background.\n");
+	mdbhandle *handle = mdb_launch();
+	if (handle == NULL)
+		return NULL;
+
+	// the caller's strings need not outlive this call
+	mdbconfig *copy = calloc(1, sizeof(mdbconfig));
+	if (copy == NULL) MDB_ERR();
+	if (config) {
+		copy->device = config_strdup(config->device);
+		copy->hwtool = config_strdup(config->hwtool);
+		copy->hwtool_p = config->hwtool_p;
+		copy->hwtool_index = config->hwtool_index;
+		copy->program = config_strdup(config->program);
+	}
+
+	handle->config = copy;
+	handle->starting = 1;
+	errno = pthread_create(&handle->startup, NULL, mdb_startup, handle);
+	if (errno) MDB_ERR();
+
 	return handle;
 }
 
 void mdb_close(mdbhandle *handle)
 {
 	MDB_DBG("Closing an MDB handle\n");
+	mdb_ready(handle);
 
 	int status = 0;
 	pdip_status(handle->pdip, &status, 1);	// let the process exit gracefully
 	pdip_delete(handle->pdip, NULL);
 
 	handle->state = mdb_dead;
+	mdb_prefetch_clear(handle);
+	size_t i;
+	for (i = 0; i < handle->tracec; i++)	// watchpoints died with the process
+		free(handle->trace[i].variable);
+	free(handle->trace);
+	arena_free(&handle->arena);
+	free(handle->sendbuf);
+	free(handle->scratch);
 	free(handle->buffer);
 	free(handle);
 }
@@ -221,67 +649,179 @@ void mdb_put(mdbhandle *handle, const char *format, ...)
 
 void mdb_vput(mdbhandle *handle, const char *format, va_list arg)
 {
-	va_list arg2;
-	va_copy(arg2, arg);
-	size_t size = vsnprintf(NULL, 0, format, arg2) + 1;
-	va_end(arg2);
-	char *buffer = malloc(size);
-
-	if (buffer == NULL) MDB_ERR();
+	mdb_ready(handle);
+	mdb_send(handle, mdb_vformat(&handle->sendbuf, &handle->sendsize, format, arg));
+}
+
+static char *mdb_reply(mdbhandle *handle, const char *command)
+{
+	// command is what the response answers, when known; if it is one of
+	// the prefetched queries its response is already in hand after a stop
+	if (mdb_recv(handle, &handle->buffer, &handle->bufsize, (struct timeval*)0)) {
+		// target is idle at a prompt; collect the follow-up queries now
+		mdbquery *prefetch = handle->prefetch;
+		size_t n = handle->prefetchc;
+		size_t i;
+		for (i = 0; command && i < n; i++)
+			if (strcmp(prefetch[i].command, command) == 0)
+				break;
+
+		if (command && i < n) {
+			// batch the others around it; swapped back so indices hold
+			mdbquery answered = prefetch[i];
+			prefetch[i] = prefetch[n-1];
+			prefetch[n-1] = answered;
+			mdb_batch(handle, prefetch, n - 1, (struct timeval*)0);
+			prefetch[n-1] = prefetch[i];
+			prefetch[i] = answered;
+		} else {
+			mdb_batch(handle, prefetch, n, (struct timeval*)0);
+		}
+	}
 
-	vsnprintf(buffer, size, format, arg);
-	MDB_DBG("%s", buffer);
-	int result = pdip_send(handle->pdip, "%s", buffer);
-	if (result < 0 ) MDB_ERR();
-	free(buffer);
+	return handle->buffer;
 }
 
 char *mdb_get(mdbhandle *handle)
 {
-	size_t basesize = 0;
-	size_t datasize = 0;
-	free(handle->buffer);
-	handle->buffer = (char *)0;
-	int result = pdip_recv(handle->pdip, MDB_PROMPT_REG, &handle->buffer, &basesize, &datasize, (struct timeval*)0);
-	if (result == PDIP_RECV_ERROR) MDB_ERR();
+	return mdb_reply(handle, NULL);
+}
 
-	// check for breakpoint message
-	static const char bp_msg[] = "Stop at";//"\nSingle breakpoint: @0x";
-	static const char halted[] = "HALTED\n";
-	//result = strncmp(handle->buffer, bp_msg, sizeof(bp_msg)/sizeof(char)-1);
-	char *breakpoint = strstr(handle->buffer, bp_msg);
-//printf("strncmp():\t%d\tsize:\t%d\n", result, sizeof(bp_msg)/sizeof(char)-1);
-	if (breakpoint && !strstr(handle->buffer, "quit")) {
-		MDB_DBG("Breakpoint detected; re-attempting read\n");
-		MDB_DBG("%s\n", handle->buffer);
-		handle->state = mdb_stopped;
-		// eat "HALTED" message
-		result = pdip_recv(handle->pdip, halted, &handle->buffer, &basesize, &datasize, (struct timeval*)0);
-		if (result == PDIP_RECV_ERROR) MDB_ERR();
-		// read the actual message we were after
-		result = pdip_recv(handle->pdip, MDB_PROMPT_REG, &handle->buffer, &basesize, &datasize, (struct timeval*)0);
-		if (result == PDIP_RECV_ERROR) MDB_ERR();
+static char *mdb_vtrans(mdbhandle *handle, mdbshmtype type, const char *format, va_list arg)
+{
+	mdb_ready(handle);
+	char *command = mdb_vformat(&handle->sendbuf, &handle->sendsize, format, arg);
+	char *result = NULL;
+
+	// prefetched results are single use, as issuing the same query again
+	// may not give the same answer (e.g. "list" advances through the file)
+	size_t i;
+	for (i = 0; i < handle->prefetchc && result == NULL; i++) {
+		mdbquery *query = &handle->prefetch[i];
+		if (query->valid && strcmp(query->command, command) == 0) {
+			MDB_DBG("Prefetched: %s", command);
+			query->valid = 0;
+			result = query->buffer;
+		}
 	}
 
-	return handle->buffer;
+	if (result == NULL) {
+		mdb_send(handle, command);
+		result = mdb_reply(handle, command);
+	}
+
+	mdb_publish(handle, type, result);
+	return result;
 }
 
 char *mdb_trans(mdbhandle *handle, const char *format, ...)
 {
 	va_list arg;
 	va_start(arg, format);
-	mdb_vput(handle, format, arg);
+	char *result = mdb_vtrans(handle, mdb_shm_result, format, arg);
 	va_end(arg);
 
-	return mdb_get(handle);
+	return result;
+}
+
+void mdb_shm_output(mdbhandle *handle, mdbshm *shm)
+{
+	mdb_ready(handle);
+	handle->shm = shm;
 }
 
 
 /*	utilities	*/
 void mdb_close_breakpoint(mdbbp *breakpoint)
 {
-	free(breakpoint->filename);
-	free(breakpoint);
+	// breakpoints now live in the handle's arena and expire with the next
+	// mdb_info_break*(); kept so existing callers still build
+	(void)breakpoint;
+}
+
+size_t mdb_footprint(mdbhandle *handle)
+{
+	mdb_ready(handle);
+	// heap held by the handle itself; pdip and the mdb process are not counted
+	size_t size = sizeof(mdbhandle) + handle->bufsize + handle->sendsize + handle->scratchsize;
+	size += handle->arena.size + handle->tracec*sizeof(mdbtrace);
+
+	size_t i;
+	for (i = 0; i < handle->prefetchc; i++)
+		size += sizeof(mdbquery) + strlen(handle->prefetch[i].command) + 1 + handle->prefetch[i].bufsize;
+	for (i = 0; i < handle->tracec; i++)
+		size += strlen(handle->trace[i].variable) + 1;
+
+	return size;
+}
+
+
+/*	prefetch	*/
+
+int mdb_prefetch(mdbhandle *handle, const char *format, ...)
+{
+	mdb_ready(handle);
+	mdbquery *prefetch = realloc(handle->prefetch, (handle->prefetchc + 1)*sizeof(mdbquery));
+	if (prefetch == NULL) MDB_ERR();
+	handle->prefetch = prefetch;
+
+	va_list arg;
+	va_start(arg, format);
+	mdbquery *query = &handle->prefetch[handle->prefetchc];
+	size_t c_size = 0;
+	query->command = NULL;
+	query->buffer = NULL;
+	query->bufsize = 0;
+	mdb_vformat(&query->command, &c_size, format, arg);
+	query->valid = 0;
+	query->stopped = 0;
+	va_end(arg);
+
+	return handle->prefetchc++;
+}
+
+int mdb_prefetch_backtrace(mdbhandle *handle, int full, int n)
+{
+	// must format exactly as mdb_backtrace() does to be matched
+	if (full)
+		return mdb_prefetch(handle, "backtrace full %d\n", n);
+	else
+		return mdb_prefetch(handle, "backtrace %d\n", n);
+}
+
+int mdb_prefetch_list(mdbhandle *handle)
+{
+	return mdb_prefetch(handle, "list\n");
+}
+
+int mdb_prefetch_var(mdbhandle *handle, char f, size_t value, const char *variable)
+{
+	// must format exactly as mdb_print_var() does to be matched
+	if (value)
+		return mdb_prefetch(handle, "print /%c /datasize:%zu %s\n", f, value, variable);
+	else
+		return mdb_prefetch(handle, "print /%c %s\n", f, variable);
+}
+
+void mdb_prefetch_clear(mdbhandle *handle)
+{
+	mdb_ready(handle);
+	size_t i;
+	for (i = 0; i < handle->prefetchc; i++) {
+		free(handle->prefetch[i].command);
+		free(handle->prefetch[i].buffer);
+	}
+	free(handle->prefetch);
+	handle->prefetch = NULL;
+	handle->prefetchc = 0;
+}
+
+void mdb_prefetch_invalidate(mdbhandle *handle)
+{
+	mdb_ready(handle);
+	size_t i;
+	for (i = 0; i < handle->prefetchc; i++)
+		handle->prefetch[i].valid = 0;
 }
 
 
@@ -433,9 +973,9 @@ int mdb_watch_name_val(mdbhandle *handle, const char *name, char *breakonType, m
 	int number = -1;
 
 	if (passCount)
-		mdb_trans(handle, "watch %s %s:%x %u\n", name, breakonType, value, passCount);
+		result = mdb_trans(handle, "watch %s %s:%x %zu\n", name, breakonType, value, passCount);
 	else
-		mdb_trans(handle, "watch %s %s:%x\n", name, breakonType, value);
+		result = mdb_trans(handle, "watch %s %s:%x\n", name, breakonType, value);
 
 	number_loc = strstr(result, wp_msg);
 	if (number_loc) {
@@ -452,22 +992,12 @@ int mdb_watch_name_val(mdbhandle *handle, const char *name, char *breakonType, m
 long mdb_print_var(mdbhandle *handle, char f, size_t value, const char *variable)
 {
 	char *result = NULL;
-	size_t size = 0;
-	if (value) {
+	if (value)
 		result = mdb_trans(handle, "print /%c /datasize:%zu %s\n", f, value, variable);
-		if (f == 'a')
-			size = snprintf(NULL, 0, "print /a /datasize:%zu %s\nThe Address of %s: ", value, variable, variable);
-		else
-			size = snprintf(NULL, 0, "print /%c /datasize:%zu %s\n%s=\n", f, value, variable, variable);
-	} else {
+	else
 		result = mdb_trans(handle, "print /%c %s\n", f, variable);
-		if (f == 'a')
-			size = snprintf(NULL, 0, "print /a %s\nThe Address of %s: ", variable, variable);
-		else
-			size = snprintf(NULL, 0, "print /%c %s\n%s=\n", f, variable, variable);
-	}
 
-	long out = strtol(result+size, NULL, 0);
+	long out = strtol(result+print_var_offset(f, value, variable), NULL, 0);
 	return out;
 }
 
@@ -493,17 +1023,20 @@ void mdb_stim(mdbhandle *handle)
 
 void mdb_write_mem(mdbhandle *handle, char t, size_t addr, int wordc, mdbword wordv[])
 {
-	size_t size = wordc*(sizeof(mdbword) + 1);
-	char *all_words = malloc(size);
-	memset(all_words, 0, size);
+	mdb_ready(handle);
 
-	size_t i;
+	// each word is at most 10 digits plus a separator
+	size_t size = wordc*11 + 1;
+	grow_buffer(&handle->scratch, &handle->scratchsize, size);
+	char *all_words = handle->scratch;
+	all_words[0] = '\0';
+
+	size_t used = 0;
+	int i;
 	for (i = 0; i < wordc; i++)
-		snprintf(all_words, size, "%s%"MDB_PRIWORD" ", all_words, wordv[i]);
-	all_words[size-1] = '\0';
+		used += snprintf(all_words + used, size - used, "%"MDB_PRIWORD" ", wordv[i]);
 
-	mdb_trans(handle, "write /%c 0x%x %s\n", t, addr, all_words);
-	free(all_words);
+	mdb_trans(handle, "write /%c 0x%zx %s\n", t, addr, all_words);
 }
 
 void mdb_write_pins(mdbhandle *handle, char *pinName, int pinState)
@@ -519,10 +1052,19 @@ void mdb_write_pinv(mdbhandle *handle, char *pinName, int pinVoltage)
 	mdb_trans(handle, "write %s high\n", pinName, pinVoltage);
 }
 
+static char *mdb_trans_type(mdbhandle *handle, mdbshmtype type, const char *format, ...)
+{
+	va_list arg;
+	va_start(arg, format);
+	char *result = mdb_vtrans(handle, type, format, arg);
+	va_end(arg);
+
+	return result;
+}
+
 const char *mdb_x(mdbhandle *handle, char t, unsigned int n, char f, char u, mdbptr addr)
 {
-	mdb_trans(handle, "x /%c%u%c%c %x\n", t, n, f, u, addr);
-	return mdb_get(handle);
+	return mdb_trans_type(handle, mdb_shm_memory, "x /%c%u%c%c %"MDB_PRIxPTR"\n", t, n, f, u, addr);
 }
 
 
@@ -577,9 +1119,9 @@ void mdb_sleep(mdbhandle *handle, unsigned int milliseconds)
 	mdb_trans(handle, "Sleep %u\n", milliseconds);
 }
 
-void mdb_stopwatch_val(mdbhandle *handle)
+unsigned long long mdb_stopwatch_val(mdbhandle *handle)
 {
-	mdb_trans(handle, "Stopwatch\n");
+	return parse_stopwatch(mdb_trans(handle, "Stopwatch\n"));
 }
 
 void mdb_stopwatch_prop(mdbhandle *handle, char *stopwatch_property)
@@ -604,19 +1146,12 @@ void mdb_cd(mdbhandle *handle, char *DIR)
 
 mdbbp **mdb_info_break(mdbhandle *handle)
 {
-	mdb_trans(handle, "info breakpoints\n");
-	return parse_breakpoints(handle->buffer);
+	return parse_breakpoints(handle, mdb_trans(handle, "info breakpoints\n"));
 }
 
 mdbbp *mdb_info_break_n(mdbhandle *handle, size_t n)
 {
-	mdb_trans(handle, "info breakpoints %u\n", n);
-	mdbbp **result = parse_breakpoints(handle->buffer);
-
-	size_t i;
-	for (i = 1; result[i] != NULL; i++)		// this should never be true, but
-		mdb_close_breakpoint(result[i]);	// to be safe and avoid leaks
-
+	mdbbp **result = parse_breakpoints(handle, mdb_trans(handle, "info breakpoints %zu\n", n));
 	return result[0];
 }
 
@@ -737,6 +1272,11 @@ void mdb_stepi_cnt(mdbhandle *handle, unsigned int count)
 	mdb_trans(handle, "Stepi %u\n", count);
 }
 
+void mdb_reset(mdbhandle *handle)
+{
+	mdb_trans(handle, "Reset\n");
+}
+
 
 // stack
 
@@ -750,3 +1290,300 @@ char *mdb_backtrace(mdbhandle *handle, int full, int n)
 	return result;
 }
 
+
+/*	tracing	*/
+
+int mdb_trace_var(mdbhandle *handle, const char *variable, char *breakonType)
+{
+	int watchpoint = mdb_watch_name(handle, variable, breakonType, 0);
+	if (watchpoint < 0)
+		return watchpoint;
+
+	mdbtrace *trace = realloc(handle->trace, (handle->tracec + 1)*sizeof(mdbtrace));
+	if (trace == NULL) MDB_ERR();
+	handle->trace = trace;
+
+	trace = &handle->trace[handle->tracec++];
+	trace->variable = strdup(variable);
+	if (trace->variable == NULL) MDB_ERR();
+	trace->watchpoint = watchpoint;
+	trace->address = mdb_print_var_addr(handle, variable);
+	trace->value = 0;
+
+	return watchpoint;
+}
+
+void mdb_trace_clear(mdbhandle *handle)
+{
+	size_t i;
+	for (i = 0; i < handle->tracec; i++) {
+		mdb_delete(handle, handle->trace[i].watchpoint);
+		free(handle->trace[i].variable);
+	}
+	free(handle->trace);
+	handle->trace = NULL;
+	handle->tracec = 0;
+}
+
+size_t mdb_trace_run(mdbhandle *handle, FILE *log, size_t hits, unsigned int timeout)
+{
+	// every hit costs a single write: the reads describing the hit are
+	// pipelined together with the Continue that resumes the target
+	enum {stopwatch, pc, vars};
+	if (handle->tracec == 0)
+		return 0;	// no watchpoints, so nothing would ever be hit
+
+	size_t queryc = vars + handle->tracec + 1;
+	mdbquery *queries = calloc(queryc, sizeof(mdbquery));
+	if (queries == NULL) MDB_ERR();
+
+	queries[stopwatch].command = strdup("Stopwatch\n");
+	queries[pc].command = strdup("print /x "MDB_PC_REG"\n");
+	queries[queryc-1].command = strdup("Continue\n");
+	if (queries[stopwatch].command == NULL || queries[pc].command == NULL || queries[queryc-1].command == NULL) MDB_ERR();
+
+	size_t i;
+	for (i = 0; i < handle->tracec; i++) {
+		char *variable = handle->trace[i].variable;
+		size_t size = snprintf(NULL, 0, "print /d %s\n", variable) + 1;
+		queries[vars+i].command = malloc(size);
+		if (queries[vars+i].command == NULL) MDB_ERR();
+		snprintf(queries[vars+i].command, size, "print /d %s\n", variable);
+	}
+
+	mdbword *values = malloc(handle->tracec*sizeof(mdbword));
+	if (values == NULL) MDB_ERR();
+
+	mdb_prefetch_invalidate(handle);
+
+	size_t hit;
+	for (hit = 0; hit <= hits; hit++) {
+		// the first pass only takes the starting values
+		struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+		mdb_batch(handle, queries, (hit < hits) ? queryc : queryc - 1, timeout ? &tv : (struct timeval*)0);
+
+		int changed = 0;
+		for (i = 0; i < handle->tracec; i++) {
+			char *result = queries[vars+i].buffer + print_var_offset('d', 0, handle->trace[i].variable);
+			values[i] = (mdbword)strtol(result, NULL, 0);
+			changed |= values[i] != handle->trace[i].value;
+		}
+
+		// a read watchpoint changes nothing, so when no value moved the hit
+		// cannot be attributed and every traced variable is logged
+		mdbtracerec rec;
+		rec.cycle = parse_stopwatch(queries[stopwatch].buffer);
+		rec.pc = strtoul(queries[pc].buffer + print_var_offset('x', 0, MDB_PC_REG), NULL, 16);
+		for (i = 0; i < handle->tracec; i++) {
+			mdbtrace *trace = &handle->trace[i];
+			if (hit && (!changed || values[i] != trace->value)) {
+				rec.address = trace->address;
+				rec.old_value = trace->value;
+				rec.new_value = values[i];
+				if (fwrite(&rec, sizeof(mdbtracerec), 1, log) != 1) MDB_ERR();
+			}
+			trace->value = values[i];
+		}
+
+		if (hit == hits)
+			break;
+
+		// a watchpoint that fires at once can be reported ahead of the
+		// Continue prompt, in which case mdb_recv() already consumed it
+		if (queries[queryc-1].stopped)
+			continue;
+
+		// wait for the next watchpoint to fire
+		size_t datasize = 0;
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		handle->state = mdb_running;
+		int result = pdip_recv(handle->pdip, MDB_HALTED_REG, &handle->buffer, &handle->bufsize, &datasize, timeout ? &tv : (struct timeval*)0);
+		if (result == PDIP_RECV_ERROR) MDB_ERR();
+
+		if (result != PDIP_RECV_FOUND) {
+			MDB_DBG("No watchpoint hit within %u ms; halting\n", timeout);
+			mdb_send(handle, "halt\n");
+			result = pdip_recv(handle->pdip, MDB_HALTED_REG, &handle->buffer, &handle->bufsize, &datasize, (struct timeval*)0);
+			if (result == PDIP_RECV_ERROR) MDB_ERR();
+			handle->state = mdb_stopped;
+			break;
+		}
+		handle->state = mdb_stopped;
+		mdb_publish(handle, mdb_shm_stop, handle->buffer);
+	}
+	free(values);
+
+	for (i = 0; i < queryc; i++) {
+		free(queries[i].command);
+		free(queries[i].buffer);
+	}
+	free(queries);
+
+	return hit;
+}
+
+int mdb_trace_read(FILE *log, mdbtracerec *rec)
+{
+	return fread(rec, sizeof(mdbtracerec), 1, log) == 1;
+}
+
+
+/*	run-until	*/
+
+#ifndef MDB_UNTIL_CHUNK
+#define MDB_UNTIL_CHUNK 4096
+#endif // MDB_UNTIL_CHUNK
+
+static long parse_x(const char *result)
+{
+	// first value of mdb "x" output: skip the echoed command and the address
+	const char *value = strchr(result, '\n');
+	if (value == NULL)
+		return 0;
+
+	const char *colon = strchr(++value, ':');
+	if (colon && colon < strchr(value, '\n'))
+		value = colon + 1;
+	return strtol(value, NULL, 16);
+}
+
+static int until_sample(mdbhandle *handle, mdbquery queries[], size_t n,
+	const mdbprobe probes[], size_t probec, long values[], mdbpred pred, void *arg)
+{
+	// probes are always the last probec queries of the batch
+	mdb_batch(handle, queries, n, (struct timeval*)0);
+
+	mdbquery *results = queries + n - probec;
+	size_t i;
+	for (i = 0; i < probec; i++) {
+		switch (probes[i].type) {
+			case mdb_probe_var:
+				values[i] = strtol(results[i].buffer + print_var_offset('d', 0, probes[i].variable), NULL, 0);
+				break;
+			case mdb_probe_pc:
+				values[i] = strtol(results[i].buffer + print_var_offset('x', 0, MDB_PC_REG), NULL, 16);
+				break;
+			case mdb_probe_mem:
+			default:
+				values[i] = parse_x(results[i].buffer);
+		}
+	}
+
+	return pred(values, arg);
+}
+
+mdbuntil mdb_until(mdbhandle *handle, const mdbprobe probes[], size_t probec,
+	mdbpred pred, void *arg, size_t maxsteps, size_t *steps)
+{
+	// layout: Reset, Stepi n, probes...; stepping forward skips the Reset
+	enum {reset, stepi, probe};
+	size_t queryc = probe + probec;
+	mdbquery *queries = calloc(queryc, sizeof(mdbquery));
+	long *values = NULL;
+	if (probec) {
+		values = malloc(probec*sizeof(long));
+		if (values == NULL) MDB_ERR();
+	}
+	if (queries == NULL) MDB_ERR();
+
+	queries[reset].command = strdup("Reset\n");
+	queries[stepi].command = malloc(32);
+	if (queries[reset].command == NULL || queries[stepi].command == NULL) MDB_ERR();
+
+	size_t i;
+	for (i = 0; i < probec; i++) {
+		const mdbprobe *p = &probes[i];
+		char **command = &queries[probe+i].command;
+		size_t size = 0;
+		switch (p->type) {
+			case mdb_probe_var:
+				size = snprintf(NULL, 0, "print /d %s\n", p->variable) + 1;
+				*command = malloc(size);
+				if (*command == NULL) MDB_ERR();
+				snprintf(*command, size, "print /d %s\n", p->variable);
+				break;
+			case mdb_probe_pc:
+				*command = strdup("print /x "MDB_PC_REG"\n");
+				break;
+			case mdb_probe_mem:
+			default:
+				size = snprintf(NULL, 0, "x /%c1x%c %"MDB_PRIxPTR"\n", p->t, p->u, p->address) + 1;
+				*command = malloc(size);
+				if (*command == NULL) MDB_ERR();
+				snprintf(*command, size, "x /%c1x%c %"MDB_PRIxPTR"\n", p->t, p->u, p->address);
+		}
+		if (*command == NULL) MDB_ERR();
+	}
+
+	mdb_prefetch_invalidate(handle);
+
+	long base = handle->stepped;
+	size_t done = 0;
+	size_t chunk = 1;
+	mdbuntil outcome = mdb_until_expired;
+
+	// the condition may already hold
+	if (until_sample(handle, queries + probe, probec, probes, probec, values, pred, arg))
+		outcome = mdb_until_met;
+
+	// single stepping costs a round trip per instruction, so step in chunks
+	// that double while the condition stays false
+	while (outcome == mdb_until_expired && done < maxsteps) {
+		size_t n = (chunk < maxsteps - done) ? chunk : maxsteps - done;
+		snprintf(queries[stepi].command, 32, "Stepi %zu\n", n);
+		done += n;
+
+		if (!until_sample(handle, queries + stepi, 1 + probec, probes, probec, values, pred, arg)) {
+			if (chunk < MDB_UNTIL_CHUNK)
+				chunk *= 2;
+			continue;
+		}
+
+		if (n == 1) {
+			outcome = mdb_until_met;
+			break;
+		}
+
+		// overshot somewhere within the last chunk; there is no stepping
+		// backwards, but when the instruction count since reset is known a
+		// deterministic target can be replayed to bisect the exact step.
+		// a breakpoint stopping a Stepi early loses the count
+		if (base < 0 || handle->stepped != base + (long)done) {
+			outcome = mdb_until_overshot;
+			break;
+		}
+
+		size_t lo = done - n;	// condition false
+		size_t hi = done;		// condition true
+		size_t at = done;
+		while (hi - lo > 1) {
+			size_t mid = lo + (hi - lo)/2;
+			snprintf(queries[stepi].command, 32, "Stepi %zu\n", base + mid);
+			at = mid;
+			if (until_sample(handle, queries, queryc, probes, probec, values, pred, arg))
+				hi = mid;
+			else
+				lo = mid;
+		}
+		if (at != hi) {
+			snprintf(queries[stepi].command, 32, "Stepi %zu\n", base + hi);
+			until_sample(handle, queries, queryc, probes, probec, values, pred, arg);
+		}
+
+		done = hi;
+		outcome = mdb_until_met;
+	}
+
+	if (steps)
+		*steps = done;
+
+	for (i = 0; i < queryc; i++) {
+		free(queries[i].command);
+		free(queries[i].buffer);
+	}
+	free(queries);
+	free(values);
+
+	return outcome;
+}
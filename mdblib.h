@@ -3,6 +3,10 @@
 
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mdbshm.h"
 
 
 #ifndef MDB_TIMEOUT
@@ -16,6 +20,9 @@
 
 typedef struct _mdbbp		mdbbp;
 typedef struct _mdbhandle	mdbhandle;
+typedef struct _mdbtracerec	mdbtracerec;
+typedef struct _mdbprobe	mdbprobe;
+typedef struct _mdbconfig	mdbconfig;
 typedef uintptr_t			mdbptr;
 typedef unsigned int		mdbword;
 
@@ -26,9 +33,48 @@ typedef enum _mdbstate {
 	mdb_sleeping
 } mdbstate;
 
+struct _mdbconfig {	// queued by mdb_init_async(); NULL members are skipped
+	char *device;		// mdb_device()
+	char *hwtool;		// mdb_hwtool()
+	int hwtool_p;
+	size_t hwtool_index;
+	char *program;		// mdb_program()
+};
+
+typedef enum _mdbuntil {
+	mdb_until_expired = 0,	// step budget used up, condition never held
+	mdb_until_met,			// stopped on the exact instruction
+	mdb_until_overshot		// condition held somewhere within the last chunk
+} mdbuntil;
+
+typedef enum _mdbprobetype {
+	mdb_probe_var = 0,
+	mdb_probe_mem,
+	mdb_probe_pc
+} mdbprobetype;
+
+struct _mdbprobe {	// one value sampled for an mdb_until() predicate
+	mdbprobetype type;
+	const char *variable;	// mdb_probe_var
+	mdbptr address;			// mdb_probe_mem, read with mdb_x() type t and unit u
+	char t;
+	char u;
+};
+
+typedef int (*mdbpred)(const long values[], void *arg);	// values in probe order
+
+struct _mdbtracerec {	// one mdb_trace_run() log entry, 24 bytes
+	uint64_t cycle;		// stopwatch cycle count at the hit
+	uint32_t address;
+	uint32_t old_value;
+	uint32_t new_value;
+	uint32_t pc;
+};
+
 
 /*	process management	*/
 mdbhandle *mdb_init();		// launches an interactive mdb process
+mdbhandle *mdb_init_async(const mdbconfig *config);	// returns at once; first use waits for startup
 void mdb_close(mdbhandle *handle);	// makes sure the process closed
 
 /*	basic I/O	*/
@@ -38,10 +84,26 @@ char *mdb_get(mdbhandle *handle);		// run after a put to collect output
 char *mdb_trans(mdbhandle *handle, const char *format, ...);	// simple combo of the two
 
 /*	utilities	*/
-void mdb_close_breakpoint(mdbbp *breakpoint);
+void mdb_close_breakpoint(mdbbp *breakpoint);	// no-op; breakpoints belong to the handle
+size_t mdb_footprint(mdbhandle *handle);	// bytes of heap held by the handle
 void mdb_noop(mdbhandle *handle);
 mdbstate mdb_state(mdbhandle *handle);
 
+/*	prefetch - queries pipelined as soon as a stop is detected in mdb_get(handle),
+	then answered from cache until anything else is sent to mdb	*/
+int mdb_prefetch(mdbhandle *handle, const char *format, ...);	// queue any query, returns its index
+int mdb_prefetch_backtrace(mdbhandle *handle, int full, int n);	// served to mdb_backtrace()
+// a prefetched "list" moves mdb's listing position even when its result goes unused,
+// so a later mdb_list() then shows the block after it; only prefetch it if it is read
+int mdb_prefetch_list(mdbhandle *handle);	// served to mdb_list()
+int mdb_prefetch_var(mdbhandle *handle, char f, size_t value, const char *variable);	// served to mdb_print_var()
+void mdb_prefetch_clear(mdbhandle *handle);	// drops the policy and its cached results
+void mdb_prefetch_invalidate(mdbhandle *handle);
+
+/*	shared-memory output - results, stop events and memory reads published
+	to readers using mdbshm.h; the channel is not owned by the handle	*/
+void mdb_shm_output(mdbhandle *handle, mdbshm *shm);	// NULL to detach
+
 /*	mdb commands - implemented using mdb_put(mdbhandle *handle) and mdb_get(mdbhandle *handle)	*/
 // breakpoints
 int mdb_break_line(mdbhandle *handle, char *filename, size_t linenumber, size_t passCount);
@@ -75,13 +137,15 @@ char *mdb_help(mdbhandle *handle, char *text);
 void mdb_quit(mdbhandle *handle);
 void mdb_set(mdbhandle *handle, char *tool_property_name, char *tool_property_value);
 void mdb_sleep(mdbhandle *handle, unsigned int milliseconds);
-void mdb_stopwatch_val(mdbhandle *handle);
+unsigned long long mdb_stopwatch_val(mdbhandle *handle);	// returns the cycle count
 void mdb_stopwatch_prop(mdbhandle *handle, char *stopwatch_property);
 void mdb_wait(mdbhandle *handle);
 void mdb_wait_ms(mdbhandle *handle, unsigned int milliseconds);
 void mdb_cd(mdbhandle *handle, char *DIR);
-mdbbp **mdb_info_break(mdbhandle *handle);
-mdbbp *mdb_info_break_n(mdbhandle *handle, size_t n);
+// breakpoints returned below are owned by the handle (never free() them) and stay
+// valid until the next mdb_info_break() or mdb_info_break_n() on that handle
+mdbbp **mdb_info_break(mdbhandle *handle);	// NULL terminated
+mdbbp *mdb_info_break_n(mdbhandle *handle, size_t n);	// NULL if n does not exist
 char *mdb_list(mdbhandle *handle);
 char *mdb_list_line(mdbhandle *handle, size_t linenum);
 char *mdb_list_first(mdbhandle *handle, size_t first);
@@ -108,9 +172,22 @@ void mdb_run(mdbhandle *handle);
 void mdb_step(mdbhandle *handle);
 void mdb_stepi(mdbhandle *handle);
 void mdb_stepi_cnt(mdbhandle *handle, unsigned int count);
+void mdb_reset(mdbhandle *handle);
+// mdb_until() samples the probes only between Stepi chunks of up to MDB_UNTIL_CHUNK
+// (4096) instructions, so a condition that holds for less than a chunk may be missed,
+// and one that is not monotone may be bisected to a later crossing. bisecting Resets
+// the target and replays it, so it needs a known count since Reset or Program
+mdbuntil mdb_until(mdbhandle *handle, const mdbprobe probes[], size_t probec,
+	mdbpred pred, void *arg, size_t maxsteps, size_t *steps);	// steps taken stored in steps
 
 // stack
 char *mdb_backtrace(mdbhandle *handle, int full, int n);
 
+/*	tracing - watchpoints on variables whose hits are logged without stopping	*/
+int mdb_trace_var(mdbhandle *handle, const char *variable, char *breakonType);	// returns the watchpoint number
+void mdb_trace_clear(mdbhandle *handle);	// deletes the tracing watchpoints
+size_t mdb_trace_run(mdbhandle *handle, FILE *log, size_t hits, unsigned int timeout);	// returns hits logged; timeout in ms, 0 waits forever
+int mdb_trace_read(FILE *log, mdbtracerec *rec);	// 0 at end of log
+
 
 #endif // MDBLIB_H_INCLUDED
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE		// strcasestr()
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdborch.h"
+
+
+#define MDB_EFRMT	"ERROR!\n\tFile:\t%s\n\tLine:\t%d\n\tFunc:\t%s()\n\tErrno:\t%d\n\tErrstr:\t%s\n"
+#define MDB_ERR() 			\
+	do {					\
+		fprintf(			\
+			stderr,			\
+			MDB_EFRMT,		\
+			__FILE__,		\
+			__LINE__,		\
+			__func__,		\
+			errno,			\
+			strerror(errno)	\
+			);				\
+		exit(1);			\
+	} while (0);
+
+
+typedef struct _mdblink {
+	size_t from;
+	char *frompin;
+	size_t to;
+	char *topin;
+	int state;		// last value read from frompin
+} mdblink;
+
+
+typedef struct _mdbworker {
+	mdborch *orch;
+	size_t device;
+	pthread_t thread;
+} mdbworker;
+
+
+struct _mdborch {
+	mdbhandle **handles;
+	size_t handlec;
+	mdblink *links;
+	size_t linkc;
+	mdbslice mode;
+	unsigned int slice;
+	size_t slices;			// slices in the current mdb_orch_run()
+	pthread_barrier_t barrier;
+};
+
+
+/*	utility functions	*/
+static int pin_state(const char *result)
+{
+	// mdb reports digital pins as "high" or "low"
+	const char *line = strchr(result, '\n');	// skip the echoed command
+	return strcasestr(line ? line : result, "high") != NULL;
+}
+
+static void *orch_worker(void *arg)
+{
+	// each device only ever touches its own handle; the two barriers keep
+	// every device in the same slice and make sure link states are read
+	// before anyone overwrites them
+	mdbworker *worker = arg;
+	mdborch *orch = worker->orch;
+	mdbhandle *handle = orch->handles[worker->device];
+
+	size_t s, i;
+	for (s = 0; s < orch->slices; s++) {
+		for (i = 0; i < orch->linkc; i++)
+			if (orch->links[i].from == worker->device)
+				orch->links[i].state = pin_state(mdb_print_pin(handle, orch->links[i].frompin));
+
+		pthread_barrier_wait(&orch->barrier);
+
+		for (i = 0; i < orch->linkc; i++)
+			if (orch->links[i].to == worker->device)
+				mdb_write_pins(handle, orch->links[i].topin, orch->links[i].state);
+
+		if (orch->mode == mdb_slice_stepi) {
+			mdb_stepi_cnt(handle, orch->slice);
+		} else {
+			mdb_continue(handle);
+			mdb_sleep(handle, orch->slice);
+			mdb_halt(handle);
+		}
+
+		pthread_barrier_wait(&orch->barrier);
+	}
+
+	return NULL;
+}
+
+
+/*	orchestration	*/
+
+mdborch *mdb_orch_new(mdbslice mode, unsigned int slice)
+{
+	mdborch *orch = malloc(sizeof(mdborch));
+	if (orch == NULL) MDB_ERR();
+
+	orch->handles = NULL;
+	orch->handlec = 0;
+	orch->links = NULL;
+	orch->linkc = 0;
+	orch->mode = mode;
+	orch->slice = slice;
+	orch->slices = 0;
+
+	return orch;
+}
+
+void mdb_orch_close(mdborch *orch)
+{
+	size_t i;
+	for (i = 0; i < orch->handlec; i++) {
+		mdb_quit(orch->handles[i]);
+		mdb_close(orch->handles[i]);
+	}
+	for (i = 0; i < orch->linkc; i++) {
+		free(orch->links[i].frompin);
+		free(orch->links[i].topin);
+	}
+	free(orch->handles);
+	free(orch->links);
+	free(orch);
+}
+
+int mdb_orch_add(mdborch *orch, char *devicename, char *executableImageFile)
+{
+	// devices start up concurrently; the first slice waits for them
+	mdbconfig config = {0};
+	config.device = devicename;
+	config.program = executableImageFile;
+
+	mdbhandle *handle = mdb_init_async(&config);
+	if (handle == NULL)
+		return -1;
+
+	mdbhandle **handles = realloc(orch->handles, (orch->handlec + 1)*sizeof(mdbhandle *));
+	if (handles == NULL) MDB_ERR();
+	orch->handles = handles;
+
+	orch->handles[orch->handlec] = handle;
+	return orch->handlec++;
+}
+
+mdbhandle *mdb_orch_handle(mdborch *orch, size_t device)
+{
+	return (device < orch->handlec) ? orch->handles[device] : NULL;
+}
+
+int mdb_orch_link(mdborch *orch, size_t from, char *frompin, size_t to, char *topin)
+{
+	if (from >= orch->handlec || to >= orch->handlec)
+		return -1;
+
+	mdblink *links = realloc(orch->links, (orch->linkc + 1)*sizeof(mdblink));
+	if (links == NULL) MDB_ERR();
+	orch->links = links;
+
+	mdblink *link = &orch->links[orch->linkc];
+	link->from = from;
+	link->frompin = strdup(frompin);
+	link->to = to;
+	link->topin = strdup(topin);
+	link->state = 0;
+	if (link->frompin == NULL || link->topin == NULL) MDB_ERR();
+
+	return orch->linkc++;
+}
+
+void mdb_orch_slice(mdborch *orch, mdbslice mode, unsigned int slice)
+{
+	orch->mode = mode;
+	orch->slice = slice;
+}
+
+unsigned long long mdb_orch_run(mdborch *orch, size_t slices)
+{
+	if (orch->handlec == 0 || slices == 0)
+		return 0;
+
+	mdbworker *workers = malloc(orch->handlec*sizeof(mdbworker));
+	if (workers == NULL) MDB_ERR();
+
+	orch->slices = slices;
+	errno = pthread_barrier_init(&orch->barrier, NULL, orch->handlec);
+	if (errno) MDB_ERR();
+
+	size_t i;
+	for (i = 0; i < orch->handlec; i++) {
+		workers[i].orch = orch;
+		workers[i].device = i;
+		errno = pthread_create(&workers[i].thread, NULL, orch_worker, &workers[i]);
+		if (errno) MDB_ERR();
+	}
+	for (i = 0; i < orch->handlec; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_barrier_destroy(&orch->barrier);
+	free(workers);
+
+	return (unsigned long long)slices*orch->slice;
+}
@@ -0,0 +1,27 @@
+#ifndef MDBORCH_H_INCLUDED
+#define MDBORCH_H_INCLUDED
+
+
+#include "mdblib.h"
+
+
+typedef struct _mdborch		mdborch;
+
+typedef enum _mdbslice {
+	mdb_slice_stepi = 0,	// slice is an instruction count, exact
+	mdb_slice_sleep			// slice is milliseconds of free running, fast
+} mdbslice;
+
+
+/*	orchestration - several devices advanced in lockstep time slices, with
+	pin states exchanged at slice boundaries and one I/O thread per device	*/
+mdborch *mdb_orch_new(mdbslice mode, unsigned int slice);
+void mdb_orch_close(mdborch *orch);	// closes every handle it owns
+int mdb_orch_add(mdborch *orch, char *devicename, char *executableImageFile);	// returns the device index
+mdbhandle *mdb_orch_handle(mdborch *orch, size_t device);
+int mdb_orch_link(mdborch *orch, size_t from, char *frompin, size_t to, char *topin);	// copies a pin every slice
+void mdb_orch_slice(mdborch *orch, mdbslice mode, unsigned int slice);
+unsigned long long mdb_orch_run(mdborch *orch, size_t slices);	// returns instructions (Stepi) or ms (Sleep) per device
+
+
+#endif // MDBORCH_H_INCLUDED
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mdbshm.h"
+
+
+#define MDB_SHM_MAGIC	0x4d444253	// "MDBS"
+#define MDB_SHM_VERSION	1
+
+#define MDB_SHM_TRUNCATED	0x1
+
+
+/*	segment layout: a header followed by hdr->slots fixed-size slots	*/
+struct _mdbshmhdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slotsize;
+	_Atomic uint64_t head;	// number of records claimed by writers so far
+};
+
+struct _mdbshmslot {
+	_Atomic uint64_t seq;	// record number + 1 once complete, 0 while written
+	uint32_t type;
+	uint32_t length;
+	uint32_t flags;
+	uint32_t reserved;
+	char data[];
+};
+
+struct _mdbshm {
+	char *name;
+	int owner;
+	struct _mdbshmhdr *hdr;
+	size_t size;
+	size_t stride;
+	uint64_t tail;		// next record this reader expects
+};
+
+
+/*	utility functions	*/
+static size_t slot_stride(size_t slotsize)
+{
+	size_t stride = sizeof(struct _mdbshmslot) + slotsize;
+	return (stride + 7) & ~(size_t)7;
+}
+
+static struct _mdbshmslot *slot_at(mdbshm *shm, uint64_t n)
+{
+	char *base = (char *)(shm->hdr + 1);
+	return (struct _mdbshmslot *)(base + (n % shm->hdr->slots)*shm->stride);
+}
+
+static mdbshm *shm_map(const char *name, int fd, size_t size, int prot)
+{
+	mdbshm *shm = malloc(sizeof(mdbshm));
+	if (shm == NULL)
+		return NULL;
+
+	shm->hdr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (shm->hdr == MAP_FAILED) {
+		free(shm);
+		return NULL;
+	}
+
+	shm->name = strdup(name);
+	shm->owner = 0;
+	shm->size = size;
+	shm->tail = 0;
+	return shm;
+}
+
+
+/*	writer	*/
+
+mdbshm *mdb_shm_create(const char *name, size_t slots, size_t slotsize)
+{
+	if (slots == 0 || slots > UINT32_MAX || slotsize > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// never take over a segment that a live writer may still be using
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return NULL;
+
+	size_t size = sizeof(struct _mdbshmhdr) + slots*slot_stride(slotsize);
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	mdbshm *shm = shm_map(name, fd, size, PROT_READ | PROT_WRITE);
+	close(fd);
+	if (shm == NULL) {
+		shm_unlink(name);
+		return NULL;
+	}
+
+	// ftruncate() zero fills, so every slot starts out with seq 0
+	shm->owner = 1;
+	shm->stride = slot_stride(slotsize);
+	shm->hdr->slots = slots;
+	shm->hdr->slotsize = slotsize;
+	shm->hdr->version = MDB_SHM_VERSION;
+	atomic_store_explicit(&shm->hdr->head, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	shm->hdr->magic = MDB_SHM_MAGIC;
+
+	return shm;
+}
+
+void mdb_shm_publish(mdbshm *shm, mdbshmtype type, const char *data, size_t length)
+{
+	// several threads may publish at once; each claims its own record
+	uint64_t n = atomic_fetch_add_explicit(&shm->hdr->head, 1, memory_order_relaxed);
+	struct _mdbshmslot *slot = slot_at(shm, n);
+
+	// readers compare seq before and after using a slot, so mark it as
+	// being rewritten before touching the payload
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->flags = 0;
+	if (length > shm->hdr->slotsize) {
+		length = shm->hdr->slotsize;
+		slot->flags |= MDB_SHM_TRUNCATED;
+	}
+	memcpy(slot->data, data, length);
+	slot->type = type;
+	slot->length = length;
+
+	atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+}
+
+
+/*	readers	*/
+
+mdbshm *mdb_shm_attach(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct _mdbshmhdr)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mdbshm *shm = shm_map(name, fd, st.st_size, PROT_READ);
+	close(fd);
+	if (shm == NULL)
+		return NULL;
+
+	if (shm->hdr->magic != MDB_SHM_MAGIC || shm->hdr->version != MDB_SHM_VERSION) {
+		mdb_shm_close(shm);
+		errno = EINVAL;
+		return NULL;
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	shm->stride = slot_stride(shm->hdr->slotsize);
+	shm->tail = atomic_load_explicit(&shm->hdr->head, memory_order_acquire);
+	return shm;
+}
+
+int mdb_shm_next(mdbshm *shm, mdbshmrec *rec)
+{
+	uint64_t head = atomic_load_explicit(&shm->hdr->head, memory_order_acquire);
+	uint64_t slots = shm->hdr->slots;
+
+	if (shm->tail == head)
+		return 0;
+
+	if (head - shm->tail > slots) {
+		shm->tail = head - slots;
+		return MDB_SHM_LOST;
+	}
+
+	struct _mdbshmslot *slot = slot_at(shm, shm->tail);
+	uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq < shm->tail + 1) {
+		// claimed, but its writer is still filling it in
+		return 0;
+	}
+	if (seq != shm->tail + 1) {
+		// a writer has already come round to this slot again
+		shm->tail++;
+		return MDB_SHM_LOST;
+	}
+
+	rec->seq = shm->tail;
+	rec->type = slot->type;
+	rec->length = slot->length;
+	rec->truncated = (slot->flags & MDB_SHM_TRUNCATED) != 0;
+	rec->data = slot->data;
+
+	shm->tail++;
+	return mdb_shm_valid(shm, rec) ? 1 : MDB_SHM_LOST;
+}
+
+int mdb_shm_valid(mdbshm *shm, const mdbshmrec *rec)
+{
+	// call after consuming rec->data in place; a changed seq means the
+	// writer lapped this reader and what was read may be torn
+	atomic_thread_fence(memory_order_acquire);
+	struct _mdbshmslot *slot = slot_at(shm, rec->seq);
+	return atomic_load_explicit(&slot->seq, memory_order_relaxed) == rec->seq + 1;
+}
+
+
+void mdb_shm_close(mdbshm *shm)
+{
+	munmap(shm->hdr, shm->size);
+	if (shm->owner)
+		shm_unlink(shm->name);
+	free(shm->name);
+	free(shm);
+}
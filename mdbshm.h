@@ -0,0 +1,50 @@
+#ifndef MDBSHM_H_INCLUDED
+#define MDBSHM_H_INCLUDED
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifndef MDB_SHM_SLOTS
+#define MDB_SHM_SLOTS 256
+#endif // MDB_SHM_SLOTS
+
+#ifndef MDB_SHM_SLOTSIZE
+#define MDB_SHM_SLOTSIZE 4096
+#endif // MDB_SHM_SLOTSIZE
+
+#define MDB_SHM_LOST	-1	// reader was lapped by the writer; records were skipped
+
+typedef struct _mdbshm		mdbshm;
+typedef struct _mdbshmrec	mdbshmrec;
+
+typedef enum _mdbshmtype {
+	mdb_shm_result = 1,
+	mdb_shm_stop,
+	mdb_shm_memory
+} mdbshmtype;
+
+struct _mdbshmrec {
+	uint64_t seq;
+	mdbshmtype type;
+	size_t length;
+	int truncated;		// data was longer than a slot
+	const char *data;	// points into the segment; NOT null terminated
+};
+
+
+/*	writer - the creating process; any of its threads may publish at once (normally
+	handles via mdb_shm_output()), as long as fewer than slots are mid-publish	*/
+mdbshm *mdb_shm_create(const char *name, size_t slots, size_t slotsize);	// POSIX shm name, e.g. "/mdb"; fails if it exists
+void mdb_shm_publish(mdbshm *shm, mdbshmtype type, const char *data, size_t length);
+
+/*	readers - any number of processes, each with its own cursor	*/
+mdbshm *mdb_shm_attach(const char *name);	// starts at the next record published
+int mdb_shm_next(mdbshm *shm, mdbshmrec *rec);	// 1 on record, 0 when caught up or next is unfinished, MDB_SHM_LOST
+int mdb_shm_valid(mdbshm *shm, const mdbshmrec *rec);	// 0 if rec was overwritten while in use
+
+void mdb_shm_close(mdbshm *shm);	// the creator also unlinks the segment
+
+
+#endif // MDBSHM_H_INCLUDED